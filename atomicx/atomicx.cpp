@@ -46,10 +46,44 @@
 
 #include <stdlib.h>
 
+#if defined(ATOMICX_POSIX_CLOCK) && !defined(ARDUINO)
+#include <time.h>
+#include <errno.h>
+#endif
+
 namespace ax {
 
     Context ctx;
 
+#if defined(ATOMICX_POSIX_CLOCK) && !defined(ARDUINO)
+    // ----------------------------------------------
+    // AtomicX POSIX clock backend, ATOMICX_TICK_NS ticks
+    // ----------------------------------------------
+    Time getTick()
+    {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (Time) now.tv_sec * (1000000000 / ATOMICX_TICK_NS) + (Time) now.tv_nsec / ATOMICX_TICK_NS;
+    }
+
+    void sleepTicks(Time nSleep)
+    {
+        struct timespec until;
+
+        clock_gettime(CLOCK_MONOTONIC, &until);
+
+        // Absolute deadline, so interrupted sleeps do not drift
+        uint64_t ns = (uint64_t) until.tv_nsec + (uint64_t) nSleep * ATOMICX_TICK_NS;
+
+        until.tv_sec += (time_t) (ns / 1000000000);
+        until.tv_nsec = (long) (ns % 1000000000);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR);
+    }
+#endif
+
     // ----------------------------------------------
     // AtomicX Timeout methods implementation
     // ----------------------------------------------
@@ -69,18 +103,21 @@ namespace ax {
     void Timeout::set(Time nTimeoutValue)
     {
         m_timeoutValue = nTimeoutValue + getTick();
+
+        // 0 means no timeout, keep a deadline landing on the wraparound
+        if (m_timeoutValue == 0) m_timeoutValue = 1;
     }
 
     bool Timeout::isTimedOut()
     {
-        return (m_timeoutValue == 0 || getTick () < m_timeoutValue) ? false : true;
+        return (m_timeoutValue == 0 || timeBefore(getTick (), m_timeoutValue)) ? false : true;
     }
 
     Time Timeout::getRemaining()
     {
         auto nNow = getTick ();
 
-        return (nNow < m_timeoutValue) ? m_timeoutValue - nNow : 0;
+        return timeBefore(nNow, m_timeoutValue) ? m_timeoutValue - nNow : 0;
     }
 
     Time Timeout::getDurationSince(Time startTime)
@@ -98,63 +135,258 @@ namespace ax {
     // ----------------------------------------------
     void Context::setNextActiveThread()
     {
-        thread* thread = nullptr;
+        if (m_wakeSources != nullptr) pollWakeSources();
 
-        thread = m_nextThread = m_activeThread;
-        
+        // Scan again whenever an external event woke a thread while idle
+        while (!selectNextThread())
+            m_switchTime = getTick();
+    }
+
+    bool Context::selectNextThread()
+    {
+        thread* affinityThread = nullptr;
+        thread* thread = m_activeThread;
+        Time deadline = 0;
+        Time nextDeadline = 0;
+        Time wakeLimit = 0;
+        bool waiting = false;
+
+        // Affinity peers are preferred while they are due, bounded
+        // by threadCount in a row so other threads are not starved
+        uint8_t affinity = (m_affinityStreak < threadCount) ? m_activeThread->metrics.affinity : 0;
+
+        m_nextThread = nullptr;
+
+        // Walk all threads starting after the active one, so the
+        // active thread is the last one to be considered
         for(size_t nCount = 0; nCount < threadCount; nCount++)
         {
-            thread = (thread == nullptr) ? begin : thread->next;
+            thread = (thread == nullptr || thread->next == nullptr) ? begin : thread->next;
 
-            if (thread != nullptr) switch (thread->metrics.state)
+            switch (thread->metrics.state)
             {
             case STATE::READY:
                 m_nextThread = thread;
-                return;
-                
+                return true;
+
             case STATE::NOW:
-                m_nextThread->metrics.nextExecTime = m_switchTime;
+                thread->metrics.nextExecTime = m_switchTime;
+                deadline = thread->metrics.nextExecTime;
+                break;
+
             case STATE::SLEEPING:
-                if (m_nextThread->metrics.nextExecTime >= thread->metrics.nextExecTime)
-                    m_nextThread = thread;
+                deadline = thread->metrics.nextExecTime;
                 break;
             
             case STATE::WAIT:
-                if (thread->metrics.waitTimeout() > 0 && thread->metrics.waitTimeout() < m_switchTime)
+                if (thread->metrics.waitTimeout() == 0)
+                {
+                    waiting = true;
+                    continue;
+                }
+
+                if (timeBefore(thread->metrics.waitTimeout(), m_switchTime))
                 {
                     thread->metrics.state = STATE::TIMEDOUT;
                     thread->metrics.nextExecTime = 0;
                     m_nextThread = thread;
-                    return;
+                    return true;
                 }
-            default:
+
+                deadline = thread->metrics.waitTimeout();
                 break;
+
+            default:
+                continue;
+            }
+
+            // Latest tick every sleeper accepts to be woken up at
+            if (m_nextThread == nullptr || timeBefore(deadline + thread->metrics.slack, wakeLimit))
+                wakeLimit = deadline + thread->metrics.slack;
+
+            if (m_nextThread == nullptr || timeBefore(deadline, nextDeadline))
+            {
+                m_nextThread = thread;
+                nextDeadline = deadline;
+            }
+
+            if (affinity != 0 && thread != m_activeThread && thread->metrics.affinity == affinity && !timeBefore(m_switchTime, deadline)
+                && affinityThread == nullptr)
+            {
+                affinityThread = thread;
             }
         }
 
-        if (m_nextThread->metrics.state == STATE::WAIT)
+        if (m_nextThread == nullptr)
         {
-            // detects if only timeoutless threads are 
-            // waiting, mark start() to finish
-            if (m_nextThread->metrics.waitTimeout() == 0)
-                m_nextThread = nullptr;
-            else
-                m_nextThread->metrics.state = STATE::TIMEDOUT;
+            // detects if only timeoutless threads are waiting, mark
+            // start() to finish unless a wake source can still wake them
+            if (m_wakeSources == nullptr || !waiting || countWakeWaiters() == 0) return true;
+
+            Time start = getTick();
+            bool woken = waitWakeSources(0, true);
+
+            m_idleMetrics.idleTime += getTick() - start;
+            m_idleMetrics.wakeups++;
+
+            return !woken;
         }
+
+        if (affinityThread != nullptr)
+        {
+            m_nextThread = affinityThread;
+            nextDeadline = m_switchTime;
+            m_affinityStreak++;
+        }
+        else
+            m_affinityStreak = 0;
+
+        if (timeBefore(m_switchTime, nextDeadline) && idleUntil(wakeLimit)) return false;
+
+        if (m_nextThread->metrics.state == STATE::WAIT)
+            m_nextThread->metrics.state = STATE::TIMEDOUT;
         else
             m_nextThread->metrics.state = STATE::RUNNING;
+
+        return true;
+    }
+
+    bool Context::idleUntil(Time wakeLimit)
+    {
+        Time wakeTime = 0;
+        Time deadline = 0;
+        size_t groupSize = 0;
+
+        // All threads due until wakeLimit share a single wakeup
+        // at the latest deadline among them
+        for(thread* thread = begin; thread != nullptr; thread = thread->next)
+        {
+            switch (thread->metrics.state)
+            {
+            case STATE::SLEEPING:
+                deadline = thread->metrics.nextExecTime;
+                break;
+
+            case STATE::WAIT:
+                deadline = thread->metrics.waitTimeout();
+                if (deadline == 0) continue;
+                break;
+
+            default:
+                continue;
+            }
+
+            if (!timeBefore(wakeLimit, deadline))
+            {
+                if (groupSize == 0 || timeBefore(wakeTime, deadline)) wakeTime = deadline;
+                groupSize++;
+            }
+        }
+
+        bool woken = false;
+        Time start = getTick();
+
+        if (m_wakeSources != nullptr)
+            woken = waitWakeSources(wakeTime, false);
+        else
+            sleepUntilTick(wakeTime);
+
+        m_idleMetrics.idleTime += getTick() - start;
+        m_idleMetrics.wakeups++;
+
+        if (groupSize > 1 && !woken) m_idleMetrics.wakeupsSaved += groupSize - 1;
+
+        return woken;
+    }
+
+    bool Context::pollWakeSources()
+    {
+        bool woken = false;
+
+        for(WakeSource* source = m_wakeSources; source != nullptr; source = source->next)
+        {
+            if (source->poll()) woken = true;
+        }
+
+        return woken;
+    }
+
+    size_t Context::countWakeWaiters()
+    {
+        size_t count = 0;
+
+        for(WakeSource* source = m_wakeSources; source != nullptr; source = source->next)
+        {
+            if (source->hasWaiters()) count++;
+        }
+
+        return count;
+    }
+
+    bool Context::waitWakeSources(Time until, bool forever)
+    {
+        Time now = getTick();
+        Time slice = 1;
+
+        while (forever || timeBefore(now, until))
+        {
+            if (pollWakeSources()) return true;
+
+            size_t count = countWakeWaiters();
+
+            // No source can wake anyone, plain sleep
+            if (count == 0)
+            {
+                if (forever) return false;
+
+                sleepUntilTick(until);
+                break;
+            }
+
+            do
+                m_idleSource = (m_idleSource == nullptr || m_idleSource->next == nullptr) ? m_wakeSources : m_idleSource->next;
+            while (!m_idleSource->hasWaiters());
+
+            // A single source blocks for the whole period, several sources
+            // are waited in turns, each turn twice as long up to
+            // ATOMICX_WAKE_SLICE_MAX ticks
+            if (count == 1)
+            {
+                m_idleSource->idle(forever ? 0 : until - now, forever);
+            }
+            else
+            {
+                m_idleSource->idle((forever || timeBefore(now + slice, until)) ? slice : until - now, false);
+
+                if (slice * 2 <= ATOMICX_WAKE_SLICE_MAX) slice *= 2;
+            }
+
+            now = getTick();
+        }
+
+        return pollWakeSources();
     }
 
     void Context::sleepUntilTick(Time until)
     {
         Time now = getTick();
 
-        if (now < until)
+        if (timeBefore(now, until))
         {
             sleepTicks(until - now);
         }
     }
 
+    const Context::IdleMetrics& Context::getIdleMetrics()
+    {
+        return m_idleMetrics;
+    }
+
+    const Context::SwitchMetrics& Context::getSwitchMetrics()
+    {
+        return m_switchMetrics;
+    }
+
     int Context::start()
     {
         m_running = true;
@@ -177,15 +409,24 @@ namespace ax {
                 {
                     if (m_activeThread->metrics.state == STATE::READY)
                     {
+                        m_stackOwner = m_activeThread;
                         m_activeThread->metrics.state = STATE::RUNNING;
                         m_activeThread->run();
                         m_activeThread->metrics.state = STATE::STOPPED;
+                        m_stackOwner = nullptr;
+                        m_switchTime = getTick();
+
+                        // Nothing saved, only the restore of the next
+                        // thread counts for this switch
+                        m_switchMetrics.lastCopied = 0;
+
+                        setNextActiveThread();
                     } else {
                         longjmp(m_activeThread->userRegs, 1);
                     }
                 }
 
-                setNextActiveThread();
+                // Otherwise yield() already picked m_nextThread
             }
         }
         return 0;
@@ -224,6 +465,26 @@ namespace ax {
         threadCount--;
     }
 
+    void Context::AddWakeSource(WakeSource* source)
+    {
+        source->next = m_wakeSources;
+        m_wakeSources = source;
+    }
+
+    void Context::RemoveWakeSource(WakeSource* source)
+    {
+        for(WakeSource** node = &m_wakeSources; *node != nullptr; node = &(*node)->next)
+        {
+            if (*node == source)
+            {
+                *node = source->next;
+                break;
+            }
+        }
+
+        m_idleSource = nullptr;
+    }
+
     thread& Context::operator()()
     {
         return *m_activeThread;
@@ -235,6 +496,10 @@ namespace ax {
 
    bool thread::yield(Timeout till, STATE cmd)
     {
+        // Waiter picked by a Notify::HANDOFF, switched to directly
+        thread* handoff = ctx.m_handoffThread;
+        ctx.m_handoffThread = nullptr;
+
         // adjusting the next execution time
         if(cmd == STATE::NOW) till.set(0);
         else if (!till() && cmd != STATE::WAIT) till.set(ctx.m_activeThread->metrics.nice);
@@ -254,22 +519,59 @@ namespace ax {
 
         if (setjmp(ctx.m_activeThread->userRegs) == 0)
         {   
-            memcpy(ctx.m_activeThread->stack.vmemory, ctx.m_activeThread->stack.userPointer, ctx.m_activeThread->metrics.stackSize);
-            
-            ctx.m_activeThread->metrics.state = cmd;
+            thread* active = ctx.m_activeThread;
+
+            active->metrics.state = cmd;
 
-            ctx.m_activeThread->metrics.nextExecTime = till();
+            active->metrics.nextExecTime = till();
 
-            //ctx.setNextActiveThread();
             ctx.m_switchTime = getTick();
 
-            longjmp(ctx.m_activeThread->kernelRegs, 1);
-        } else {
+            // Skip the scheduler loop for the handoff thread
+            if (handoff != nullptr && handoff->metrics.state == STATE::NOW)
+            {
+                handoff->metrics.state = STATE::RUNNING;
+                ctx.m_nextThread = handoff;
+            }
+            else
+                ctx.setNextActiveThread();
+
+            thread* next = ctx.m_nextThread;
+
+            // Rescheduled itself, the live stack is still its own
+            if (next == active)
+            {
+                ctx.m_switchMetrics.sameThread++;
+                ctx.m_switchMetrics.lastCopied = 0;
+            }
+            else
+            {
+                // Evict the frames only now another thread will overwrite them
+                memcpy(active->stack.vmemory, active->stack.userPointer, active->metrics.stackSize);
+
+                ctx.m_switchMetrics.switches++;
+                ctx.m_switchMetrics.bytesCopied += active->metrics.stackSize;
+                ctx.m_switchMetrics.lastCopied = active->metrics.stackSize;
+
+                // Resume the next thread straight away, it was already
+                // started by the kernel so its kernelRegs are valid to
+                // get back to start(), new threads and the end of
+                // the scheduling are left to start()
+                if (next != nullptr && next->metrics.state != STATE::READY)
+                {
+                    ctx.m_activeThread = next;
+                    longjmp(next->userRegs, 1);
+                }
+
+                longjmp(active->kernelRegs, 1);
+            }
+        } else if (ctx.m_stackOwner != ctx.m_activeThread) {
             memcpy(ctx.m_activeThread->stack.userPointer, ctx.m_activeThread->stack.vmemory, ctx.m_activeThread->metrics.stackSize);
-        }
 
-        if (ctx.m_activeThread->metrics.state == STATE::RUNNING)
-            ctx.sleepUntilTick(ctx.m_activeThread->metrics.nextExecTime);
+            ctx.m_stackOwner = ctx.m_activeThread;
+            ctx.m_switchMetrics.bytesCopied += ctx.m_activeThread->metrics.stackSize;
+            ctx.m_switchMetrics.lastCopied += ctx.m_activeThread->metrics.stackSize;
+        }
 
         ctx.m_activeThread->metrics.nextExecTime = getTick();
 
@@ -278,7 +580,7 @@ namespace ax {
 
     bool thread::yieldUntil(Time timeout, size_t till, STATE cmd)
     {   
-        if(ctx.m_activeThread->metrics.nextExecTime + timeout <= getTick()) 
+        if(!timeBefore(getTick(), ctx.m_activeThread->metrics.nextExecTime + timeout))
             return yield(till, cmd);
 
         return true;
@@ -330,6 +632,32 @@ namespace ax {
         return true;
     }
 
+    bool thread::setSlack(Time slack)
+    {
+        metrics.slack = slack;
+        return true;
+    }
+
+    bool thread::setAffinity(uint8_t group)
+    {
+        metrics.affinity = group;
+        return true;
+    }
+
+    // ----------------------------------------------
+    // Wake source
+    // ----------------------------------------------
+
+    WakeSource::WakeSource()
+    {
+        ctx.AddWakeSource(this);
+    }
+
+    WakeSource::~WakeSource()
+    {
+        ctx.RemoveWakeSource(this);
+    }
+
     // ----------------------------------------------
     // Wait / Notify methods implementation
     // ----------------------------------------------
@@ -358,9 +686,10 @@ namespace ax {
         return true;
     }
 
-    size_t thread::doNotification(RefId& refId, Notify type, Tag& tag, uint8_t channel)
+    size_t thread::doNotification(RefId& refId, Notify type, Tag& tag, uint8_t channel, thread** woken)
     {
         size_t count = 0;
+        thread* waiter = nullptr;
 
         for(auto* i = begin(); i != nullptr; i = i->next)
         {
@@ -368,32 +697,63 @@ namespace ax {
             {
                 if(i->metrics.waitChannel == channel && i->metrics.refId == &refId)
                 {
-                    i->metrics.state = STATE::NOW;
-                    i->metrics.nextExecTime = getTick();
-                    i->metrics.tag = tag;
-                    count++;
-
-                    //std::cout << "NOTIFY: tag:" << tag.param << "/" << tag.value << std::endl;
+                    if (type == Notify::ALL)
+                    {
+                        i->wakeUp(tag);
+                        count++;
+                    }
+                    else if (waiter == nullptr || (metrics.affinity != 0 && i->metrics.affinity == metrics.affinity))
+                    {
+                        // Single wakeups prefer a waiter on the notifier affinity group
+                        waiter = i;
 
-                    if(type == Notify::ONE) break;
+                        if (metrics.affinity == 0 || i->metrics.affinity == metrics.affinity) break;
+                    }
                 }
             }
         }
 
+        if (waiter != nullptr)
+        {
+            waiter->wakeUp(tag);
+            count++;
+
+            //std::cout << "NOTIFY: tag:" << tag.param << "/" << tag.value << std::endl;
+
+            if (woken != nullptr) *woken = waiter;
+        }
+
         return count;
     }
 
+    void thread::wakeUp(Tag& tag)
+    {
+        metrics.state = STATE::NOW;
+        metrics.nextExecTime = getTick();
+        metrics.tag = tag;
+    }
+
+    size_t thread::signal(RefId& refId, Notify type, Tag tag, uint8_t channel)
+    {
+        // Nothing to switch to without a yield, HANDOFF is a plain ONE
+        return doNotification(refId, type == Notify::HANDOFF ? Notify::ONE : type, tag, channel);
+    }
+
     size_t thread::notify(RefId& refId, Notify type, Tag tag, Timeout timeout, uint8_t channel)
     {
         size_t count = 0;
         Tag sysTag = {0,0};
+        thread* woken = nullptr;
 
         do 
-            count = doNotification(refId, type, tag, channel);
+            count = doNotification(refId, type, tag, channel, &woken);
         while(!count  
               && timeout() > 0 && !timeout.isTimedOut()
               && wait(refId, sysTag, timeout, ATIMICX_SYS_CHANEL));
 
+        // Only consumed by the yield right below
+        if (count && type == Notify::HANDOFF) ctx.m_handoffThread = woken;
+
         if (!count || !yield(0, STATE::NOW)) return 0; 
 
         return count;
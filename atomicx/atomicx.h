@@ -47,20 +47,59 @@
 // parameters automatically
 #define VMEM(vmemory) vmemory[0], sizeof(vmemory) / sizeof(size_t)
 
+// Time type, 32 bits ticks on Arduino/AVR and 64 bits elsewhere.
+// ATOMICX_TIME_TYPE and ATOMICX_TIME_DIFF_TYPE (its signed
+// counterpart) can be defined together to override it
+#ifndef ATOMICX_TIME_TYPE
+#if defined(ARDUINO) || defined(__AVR__)
+#define ATOMICX_TIME_TYPE uint32_t
+#define ATOMICX_TIME_DIFF_TYPE int32_t
+#else
+#define ATOMICX_TIME_TYPE uint64_t
+#define ATOMICX_TIME_DIFF_TYPE int64_t
+#endif
+#endif
+
+// Tick length in nanoseconds, microseconds for the POSIX clock
+// backend (ATOMICX_POSIX_CLOCK) and milliseconds otherwise
+#ifndef ATOMICX_TICK_NS
+#ifdef ATOMICX_POSIX_CLOCK
+#define ATOMICX_TICK_NS 1000
+#else
+#define ATOMICX_TICK_NS 1000000
+#endif
+#endif
+
+// Longest turn, in ticks, the Context blocks on one of several
+// wake sources with waiters before checking the next one (10ms)
+#ifndef ATOMICX_WAKE_SLICE_MAX
+#define ATOMICX_WAKE_SLICE_MAX (10000000 / ATOMICX_TICK_NS)
+#endif
+
 namespace ax {
 
 #define ATIMICX_SYS_CHANEL 255
 
     class thread;
+    class WakeSource;
 
-    using Time = uint32_t;
+    using Time = ATOMICX_TIME_TYPE;
+    using TimeDiff = ATOMICX_TIME_DIFF_TYPE;
     using RefId = size_t;
 
     // Those functions MUST be 
-    // implemented by the user
+    // implemented by the user, unless
+    // ATOMICX_POSIX_CLOCK is defined
     Time getTick();
     void sleepTicks(Time nsleep);
 
+    // Wraparound safe, true if tick a comes before tick b, valid
+    // while they are less than half of the Time range apart
+    inline bool timeBefore(Time a, Time b)
+    {
+        return (TimeDiff) (a - b) < 0;
+    }
+
     enum class STATE 
     {
         READY,
@@ -81,7 +120,8 @@ namespace ax {
     enum class Notify
     {
         ONE,
-        ALL
+        ALL,
+        HANDOFF     // Wake one waiter and switch straight to it
     };
 
     struct Tag
@@ -133,13 +173,48 @@ namespace ax {
 
         void RemoveThread(thread* thread);
 
+        void AddWakeSource(WakeSource* source);
+
+        void RemoveWakeSource(WakeSource* source);
+
         thread& operator()();
 
+        // Tickless idle counters
+        struct IdleMetrics
+        {
+            Time idleTime{0};
+            size_t wakeups{0};
+            size_t wakeupsSaved{0};
+        };
+
+        const IdleMetrics& getIdleMetrics();
+
+        // Stack copy counters, bytes saved and restored
+        struct SwitchMetrics
+        {
+            size_t switches{0};
+            size_t sameThread{0};
+            uint64_t bytesCopied{0};
+            size_t lastCopied{0};
+        };
+
+        const SwitchMetrics& getSwitchMetrics();
+
     private:
         friend class thread;
 
         bool CheckAllThreadsStopped();
 
+        bool selectNextThread();
+
+        bool idleUntil(Time wakeLimit);
+
+        bool pollWakeSources();
+
+        size_t countWakeWaiters();
+
+        bool waitWakeSources(Time until, bool forever);
+
         thread* begin{nullptr};
         thread* last{nullptr};
         size_t threadCount{0};
@@ -149,10 +224,52 @@ namespace ax {
         thread *m_nextThread;
 
         Time m_switchTime{0};
+
+        IdleMetrics m_idleMetrics;
+        SwitchMetrics m_switchMetrics;
+
+        // Thread whose frames are on the live stack
+        thread* m_stackOwner{nullptr};
+
+        thread* m_handoffThread{nullptr};
+        size_t m_affinityStreak{0};
+
+        WakeSource* m_wakeSources{nullptr};
+        WakeSource* m_idleSource{nullptr};
     };
 
     extern Context ctx;
 
+    /**
+     * @brief External event source (other processes, devices...)
+     *
+     * Sources are polled on every scheduling pass and, when no thread
+     * is due, the Context blocks on them instead of sleeping so an
+     * external event wakes the waiting threads right away.
+     */
+    class WakeSource
+    {
+    public:
+        WakeSource();
+
+        virtual ~WakeSource();
+
+        // Notify the threads waiting for pending events, true if any was woken
+        virtual bool poll() = 0;
+
+        // Local threads are parked waiting for this source
+        virtual bool hasWaiters() = 0;
+
+        // Block up to `ticks` (or forever) until an event may be pending,
+        // only called while hasWaiters()
+        virtual void idle(Time ticks, bool forever) = 0;
+
+    private:
+        friend class Context;
+
+        WakeSource* next{nullptr};
+    };
+
     // ----------------------------------------------
     // Thread class
     // ----------------------------------------------
@@ -171,6 +288,8 @@ namespace ax {
             uint16_t poolId{0};
 
             Time nice{0};
+            Time slack{0};
+            uint8_t affinity{0};
             Time nextExecTime{0};
 
             size_t maxStackSize{0};
@@ -198,7 +317,9 @@ namespace ax {
 
         bool virtual StackOverflow() = 0;
  
-        size_t doNotification(RefId& refId, Notify type, Tag& tag, uint8_t channel);
+        size_t doNotification(RefId& refId, Notify type, Tag& tag, uint8_t channel, thread** woken = nullptr);
+
+        void wakeUp(Tag& tag);
 
     public:
         bool yield(Timeout arg = 0, STATE cmd = STATE::SLEEPING);
@@ -220,10 +341,20 @@ namespace ax {
         // Set Metrics data
         bool setNice(Time nice);
 
+        // Ticks a wakeup can be delayed to be coalesced with others
+        bool setSlack(Time slack);
+
+        // Threads on the same group (0 = none) are scheduled back to back
+        bool setAffinity(uint8_t group);
+
         // Wait and notify
         bool wait(RefId& refId, Tag& tag, Timeout timeout, uint8_t channel);
 
         size_t notify(RefId& refId, Notify type, Tag tag, Timeout timeout, uint8_t channel);
+
+        // Wake waiters without yielding, they run on the next scheduling
+        // point (HANDOFF behaves as ONE)
+        size_t signal(RefId& refId, Notify type, Tag tag, uint8_t channel);
     };
 }; // namespace ax
 
@@ -0,0 +1,521 @@
+/**
+ * @file executor.h
+ * @brief AtomicX job executor and futures
+ *
+ * An executor runs short jobs on a fixed set of worker threads, so the
+ * stack memory is bounded by the number of workers no matter how many
+ * jobs are in flight. submit() queues a function and its argument and
+ * returns a Future that any thread can get() the result from, parking
+ * in WAIT until the job is done or the timeout expires.
+ *
+ * The job queue needs no lock, threads are cooperative and only switch
+ * on yield, so queue updates are never interleaved.
+ *
+ * Jobs returning void give a Future<void>, its get(timeout) only waits
+ * for the job to finish, so whenAll() over them joins side effect tasks.
+ *
+ * A job slot is owned by the futures referring to it and goes back to
+ * the executor once the job is done and the last of them is released or
+ * destroyed, so discarding the future of submit() runs the job detached.
+ *
+ * @note Arguments and results are copied with memcpy into the job slot,
+ * they must be trivially copyable and fit ATOMICX_JOB_STORAGE bytes.
+ *
+ * @code
+ *  int square(int value) { return value * value; }
+ *
+ *  ax::Executor<2, 64, 256> executor;
+ *
+ *  // Inside a thread
+ *  ax::Future<int> future = executor.submit(square, 7);
+ *  int result;
+ *  if (future.get(result, 1000)) ...
+ * @endcode
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ATOMICX_EXECUTOR_H
+#define ATOMICX_EXECUTOR_H
+
+#include "atomicx.h"
+#include "queue.h"
+
+// Bytes reserved per job for its argument and result
+#ifndef ATOMICX_JOB_STORAGE
+#define ATOMICX_JOB_STORAGE (sizeof(size_t) * 4)
+#endif
+
+namespace ax {
+
+    enum class JOB : uint8_t
+    {
+        FREE,
+        QUEUED,
+        RUNNING,
+        DONE
+    };
+
+    /**
+     * @brief Job control block, owned by the Executor
+     */
+    struct JobSlot
+    {
+        enum : uint8_t { DONE_CHANNEL = 1 };
+
+        JOB state{JOB::FREE};
+        size_t generation{0};
+
+        // Live futures referring to this job
+        size_t handles{0};
+
+        void (*invoke)(JobSlot& slot){nullptr};
+        void (*function)(){nullptr};
+        uint8_t storage[ATOMICX_JOB_STORAGE];
+
+        // Waiters for this job
+        RefId refId{0};
+
+        // Waiters for any job of the same executor
+        RefId* completion{nullptr};
+
+        // Executor free slots list
+        JobSlot** freeList{nullptr};
+        JobSlot* next{nullptr};
+
+        void recycle()
+        {
+            state = JOB::FREE;
+            generation++;
+
+            next = *freeList;
+            *freeList = this;
+        }
+    };
+
+    /**
+     * @brief Runs the function stored on a job slot, A is void for
+     *        functions without argument and T for jobs without result
+     */
+    template <typename T, typename A>
+    struct JobInvoker
+    {
+        static void invoke(JobSlot& slot)
+        {
+            static_assert(sizeof(A) <= ATOMICX_JOB_STORAGE && sizeof(T) <= ATOMICX_JOB_STORAGE, "Increase ATOMICX_JOB_STORAGE");
+
+            A arg;
+            memcpy(&arg, slot.storage, sizeof(A));
+
+            T result = ((T (*)(A)) slot.function)(arg);
+            memcpy(slot.storage, &result, sizeof(T));
+        }
+    };
+
+    template <typename T>
+    struct JobInvoker<T, void>
+    {
+        static void invoke(JobSlot& slot)
+        {
+            static_assert(sizeof(T) <= ATOMICX_JOB_STORAGE, "Increase ATOMICX_JOB_STORAGE");
+
+            T result = ((T (*)()) slot.function)();
+            memcpy(slot.storage, &result, sizeof(T));
+        }
+    };
+
+    template <typename A>
+    struct JobInvoker<void, A>
+    {
+        static void invoke(JobSlot& slot)
+        {
+            static_assert(sizeof(A) <= ATOMICX_JOB_STORAGE, "Increase ATOMICX_JOB_STORAGE");
+
+            A arg;
+            memcpy(&arg, slot.storage, sizeof(A));
+
+            ((void (*)(A)) slot.function)(arg);
+        }
+    };
+
+    template <>
+    struct JobInvoker<void, void>
+    {
+        static void invoke(JobSlot& slot)
+        {
+            ((void (*)()) slot.function)();
+        }
+    };
+
+    template <size_t WORKERS, size_t JOBS, size_t STACK>
+    class Executor;
+
+    template <typename T>
+    class Future;
+
+    template <typename T>
+    bool whenAny(Future<T>* futures, size_t count, size_t& index, Timeout timeout = TIME::UNDERFINED);
+
+    /**
+     * @brief Job state part of Future, shared by all result types
+     *
+     * Every copy holds a reference on the job slot, dropped by get(),
+     * release() or its destruction, after that the future is no longer
+     * valid and the slot is recycled once no other copy refers to it.
+     */
+    class FutureBase
+    {
+        public:
+            FutureBase(const FutureBase& other) : m_slot(other.m_slot), m_generation(other.m_generation)
+            {
+                acquire();
+            }
+
+            FutureBase& operator=(const FutureBase& other)
+            {
+                if (this != &other)
+                {
+                    release();
+
+                    m_slot = other.m_slot;
+                    m_generation = other.m_generation;
+
+                    acquire();
+                }
+
+                return *this;
+            }
+
+            ~FutureBase()
+            {
+                release();
+            }
+
+            bool isValid() const
+            {
+                return m_slot != nullptr && m_slot->generation == m_generation && m_slot->state != JOB::FREE;
+            }
+
+            bool isReady() const
+            {
+                return isValid() && m_slot->state == JOB::DONE;
+            }
+
+            // Park until the job is done, false on timeout or invalid future
+            bool wait(Timeout timeout = TIME::UNDERFINED)
+            {
+                Tag tag{0, 0};
+
+                while (isValid() && !isReady())
+                {
+                    if (!ctx().wait(m_slot->refId, tag, timeout, JobSlot::DONE_CHANNEL)) return false;
+                }
+
+                return isReady();
+            }
+
+            // Drop this reference to the job without fetching the result
+            void release()
+            {
+                if (isValid())
+                {
+                    // A queued or running job is recycled by its worker
+                    if (--m_slot->handles == 0 && m_slot->state == JOB::DONE)
+                        m_slot->recycle();
+                }
+
+                m_slot = nullptr;
+            }
+
+        protected:
+            FutureBase() = default;
+
+            FutureBase(JobSlot* slot) : m_slot(slot), m_generation(slot->generation)
+            {
+                acquire();
+            }
+
+            void acquire()
+            {
+                if (isValid())
+                    m_slot->handles++;
+                else
+                    m_slot = nullptr;
+            }
+
+            JobSlot* m_slot{nullptr};
+
+        private:
+            template <typename U>
+            friend bool whenAny(Future<U>* futures, size_t count, size_t& index, Timeout timeout);
+
+            size_t m_generation{0};
+    };
+
+    /**
+     * @brief Handle to the result of a submitted job
+     */
+    template <typename T>
+    class Future : public FutureBase
+    {
+        public:
+            Future() = default;
+
+            // Wait for and fetch the result, releasing this future
+            bool get(T& value, Timeout timeout = TIME::UNDERFINED)
+            {
+                if (!wait(timeout)) return false;
+
+                memcpy(&value, m_slot->storage, sizeof(T));
+                release();
+
+                return true;
+            }
+
+        private:
+            template <size_t WORKERS, size_t JOBS, size_t STACK>
+            friend class Executor;
+
+            Future(JobSlot* slot) : FutureBase(slot)
+            {}
+    };
+
+    /**
+     * @brief Handle to a submitted job without result
+     */
+    template <>
+    class Future<void> : public FutureBase
+    {
+        public:
+            Future() = default;
+
+            // Wait for the job to finish, releasing this future
+            bool get(Timeout timeout = TIME::UNDERFINED)
+            {
+                if (!wait(timeout)) return false;
+
+                release();
+
+                return true;
+            }
+
+        private:
+            template <size_t WORKERS, size_t JOBS, size_t STACK>
+            friend class Executor;
+
+            Future(JobSlot* slot) : FutureBase(slot)
+            {}
+    };
+
+    /**
+     * @brief Park until all futures are done
+     *
+     * @return false on timeout or if any future is invalid
+     */
+    template <typename T>
+    bool whenAll(Future<T>* futures, size_t count, Timeout timeout = TIME::UNDERFINED)
+    {
+        for (size_t nCount = 0; nCount < count; nCount++)
+        {
+            if (!futures[nCount].wait(timeout)) return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Park until any future is done, all futures
+     *        must come from the same executor
+     *
+     * @param index  Set to the first ready future
+     *
+     * @return false on timeout or if no future is valid
+     */
+    template <typename T>
+    bool whenAny(Future<T>* futures, size_t count, size_t& index, Timeout timeout)
+    {
+        RefId* completion = nullptr;
+        Tag tag{0, 0};
+
+        while (true)
+        {
+            for (index = 0; index < count; index++)
+            {
+                if (futures[index].isReady()) return true;
+
+                if (futures[index].isValid()) completion = futures[index].m_slot->completion;
+            }
+
+            if (completion == nullptr || !ctx().wait(*completion, tag, timeout, JobSlot::DONE_CHANNEL)) return false;
+        }
+    }
+
+    /**
+     * @brief Fixed pool of worker threads running queued jobs
+     *
+     * @tparam WORKERS  Number of worker threads
+     * @tparam JOBS     Maximum number of jobs in flight
+     * @tparam STACK    Worker stack size in size_t words, see VMEM
+     */
+    template <size_t WORKERS, size_t JOBS, size_t STACK>
+    class Executor
+    {
+        // Keeps the argument type out of template deduction
+        template <typename A>
+        struct Identity
+        {
+            using type = A;
+        };
+
+        public:
+            Executor()
+            {
+                for (size_t nCount = 0; nCount < WORKERS; nCount++)
+                    m_workers[nCount].m_executor = this;
+
+                for (size_t nCount = 0; nCount < JOBS; nCount++)
+                {
+                    m_slots[nCount].completion = &m_completion;
+                    m_slots[nCount].freeList = &m_free;
+                    m_slots[nCount].next = (nCount + 1 < JOBS) ? &m_slots[nCount + 1] : nullptr;
+                }
+
+                m_free = &m_slots[0];
+            }
+
+            /**
+             * @brief Queue function(arg) to run on a worker
+             *
+             * @return Future for the result, invalid if all job slots are in use
+             */
+            template <typename T, typename A>
+            Future<T> submit(T (*function)(A), typename Identity<A>::type arg)
+            {
+                JobSlot* slot = enqueue(&JobInvoker<T, A>::invoke, (void (*)()) function);
+
+                if (slot == nullptr) return Future<T>();
+
+                memcpy(slot->storage, &arg, sizeof(A));
+
+                return Future<T>(slot);
+            }
+
+            template <typename T>
+            Future<T> submit(T (*function)())
+            {
+                JobSlot* slot = enqueue(&JobInvoker<T, void>::invoke, (void (*)()) function);
+
+                if (slot == nullptr) return Future<T>();
+
+                return Future<T>(slot);
+            }
+
+            size_t getPending() const
+            {
+                return m_queue.size();
+            }
+
+            size_t getCompleted() const
+            {
+                return m_completed;
+            }
+
+        private:
+            class Worker : public thread
+            {
+                public:
+                    Worker() : thread(VMEM(vmemory))
+                    {}
+
+                protected:
+                    bool run() override
+                    {
+                        Tag tag{0, 0};
+                        JobSlot* slot = nullptr;
+
+                        while (true)
+                        {
+                            while (!m_executor->m_queue.pop(slot))
+                            {
+                                if (!wait(m_executor->m_queue.getRefId(), tag, TIME::UNDERFINED, Queue<JobSlot*, JOBS>::DATA_CHANNEL))
+                                    return false;
+                            }
+
+                            if (!m_executor->execute(*slot)) continue;
+
+                            size_t count = signal(slot->refId, Notify::ALL, {0, 0}, JobSlot::DONE_CHANNEL);
+                            count += signal(m_executor->m_completion, Notify::ALL, {0, 0}, JobSlot::DONE_CHANNEL);
+
+                            if (count && !yield(0, STATE::NOW)) return false;
+                        }
+                    }
+
+                    bool StackOverflow() override
+                    {
+                        return false;
+                    }
+
+                private:
+                    friend class Executor;
+
+                    Executor* m_executor{nullptr};
+                    size_t vmemory[STACK];
+            };
+
+            JobSlot* enqueue(void (*invoke)(JobSlot&), void (*function)())
+            {
+                JobSlot* slot = m_free;
+
+                if (slot == nullptr) return nullptr;
+
+                m_free = slot->next;
+
+                slot->invoke = invoke;
+                slot->function = function;
+                slot->state = JOB::QUEUED;
+
+                m_queue.push(slot);
+
+                // The job runs once the submitting thread yields
+                ctx().signal(m_queue.getRefId(), Notify::ONE, {0, 0}, Queue<JobSlot*, JOBS>::DATA_CHANNEL);
+
+                return slot;
+            }
+
+            // Run the job, false if no future refers to it anymore
+            bool execute(JobSlot& slot)
+            {
+                slot.state = JOB::RUNNING;
+                slot.invoke(slot);
+                slot.state = JOB::DONE;
+
+                m_completed++;
+
+                if (slot.handles != 0) return true;
+
+                slot.recycle();
+
+                return false;
+            }
+
+            Worker m_workers[WORKERS];
+
+            JobSlot m_slots[JOBS];
+            JobSlot* m_free{nullptr};
+
+            Queue<JobSlot*, JOBS> m_queue;
+            RefId m_completion{0};
+
+            size_t m_completed{0};
+    };
+
+}; // namespace ax
+
+#endif // ATOMICX_EXECUTOR_H
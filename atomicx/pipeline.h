@@ -0,0 +1,367 @@
+/**
+ * @file pipeline.h
+ * @brief AtomicX dataflow pipeline
+ *
+ * A pipeline is a chain of stages (parse, filter, aggregate, emit...)
+ * where every stage is a thread running a user function over the items
+ * it receives on a bounded queue, forwarding the accepted items to the
+ * next stage queue.
+ *
+ * Items are moved in batches of up to BATCH items per wakeup and a stage
+ * that finds the next queue full parks in WAIT until the downstream stage
+ * frees space (backpressure), so a slow stage throttles the ones before it
+ * instead of growing memory.
+ *
+ * Every stage keeps its own metrics (throughput, queue occupancy, the time
+ * spent running its function and parked) and the pipeline can point out
+ * the bottleneck stage.
+ *
+ * @code
+ *  using SensorPipe = ax::Pipeline<Sample, 16>;
+ *
+ *  SensorPipe sensors;
+ *  SensorPipe::Stage<256> parse (sensors, "parse", parseFunction);
+ *  SensorPipe::Stage<256> filter (sensors, "filter", filterFunction);
+ *  SensorPipe::Stage<256> emit (sensors, "emit", emitFunction);
+ * @endcode
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ATOMICX_PIPELINE_H
+#define ATOMICX_PIPELINE_H
+
+#include "atomicx.h"
+#include "queue.h"
+
+// Ticks an exhausted source stage sleeps before polling its function
+// again, unless the stage nice is set (1ms, at least one tick)
+#ifndef ATOMICX_PIPELINE_POLL
+#define ATOMICX_PIPELINE_POLL ((1000000 / ATOMICX_TICK_NS) ? (1000000 / ATOMICX_TICK_NS) : 1)
+#endif
+
+namespace ax {
+
+    /**
+     * @brief Dataflow pipeline builder
+     *
+     * @tparam T      Item type carried between the stages
+     * @tparam DEPTH  Capacity of the queue in front of every stage
+     * @tparam BATCH  Maximum number of items moved per wakeup
+     */
+    template <typename T, size_t DEPTH, size_t BATCH = 4>
+    class Pipeline
+    {
+        public:
+
+            /**
+             * @brief Stage function
+             *
+             * The first stage is the source and receives a default constructed
+             * item to fill, returning false when there is nothing to produce,
+             * it is then polled again every poll period (see Pipeline()).
+             * The other stages receive the item from the previous stage and
+             * return false to drop it (filter / aggregate), the return of the
+             * last stage is only accounted as dropped or not.
+             */
+            using Function = bool (*)(T& item);
+
+            struct StageMetrics
+            {
+                size_t items{0};
+                size_t dropped{0};
+                size_t batches{0};
+
+                // Input queue size, sampled once per batch
+                size_t occupancySum{0};
+
+                // Ticks spent inside the stage function
+                Time busyTime{0};
+
+                Time blockedTime{0};
+                Time starvedTime{0};
+                Time startTime{0};
+
+                bool stackOverflow{false};
+            };
+
+            /**
+             * @brief Stage thread, memory free part of Stage
+             */
+            class Node : public thread
+            {
+                public:
+                    Node(Pipeline& pipeline, const char* name, Function function, size_t& vmemory, size_t stackSize) :
+                        thread(vmemory, stackSize), m_pipeline(pipeline), m_name(name), m_function(function)
+                    {
+                        m_pipeline.append(this);
+                    }
+
+                    const char* getName() const
+                    {
+                        return m_name;
+                    }
+
+                    Node* getNext()
+                    {
+                        return m_next;
+                    }
+
+                    const StageMetrics& getStageMetrics() const
+                    {
+                        return m_metrics;
+                    }
+
+                    size_t getQueueSize() const
+                    {
+                        return m_input.size();
+                    }
+
+                    size_t getQueueHighWater() const
+                    {
+                        return m_input.getHighWater();
+                    }
+
+                    size_t getAverageOccupancy() const
+                    {
+                        return m_metrics.batches ? m_metrics.occupancySum / m_metrics.batches : 0;
+                    }
+
+                    // Items processed every `period` ticks since the stage started
+                    size_t getThroughput(Time period)
+                    {
+                        Time elapsed = getTick() - m_metrics.startTime;
+
+                        return elapsed ? (size_t) (((uint64_t) m_metrics.items * period) / elapsed) : 0;
+                    }
+
+                    Time getParkedTime() const
+                    {
+                        return m_metrics.blockedTime + m_metrics.starvedTime;
+                    }
+
+                    // Percentage of the time since the stage started spent on its function
+                    size_t getBusyShare()
+                    {
+                        Time elapsed = getTick() - m_metrics.startTime;
+
+                        return elapsed ? (size_t) (((uint64_t) m_metrics.busyTime * 100) / elapsed) : 0;
+                    }
+
+                protected:
+                    bool run() override
+                    {
+                        T batch[BATCH];
+
+                        m_metrics.startTime = getTick();
+
+                        while (!m_metrics.stackOverflow)
+                        {
+                            size_t count = (m_prev == nullptr) ? produce(batch) : consume(batch);
+
+                            forward(batch, count);
+                        }
+
+                        return false;
+                    }
+
+                    bool StackOverflow() override
+                    {
+                        m_metrics.stackOverflow = true;
+                        return false;
+                    }
+
+                private:
+                    friend class Pipeline;
+
+                    size_t produce(T* batch)
+                    {
+                        size_t count = 0;
+                        Time start = getTick();
+
+                        while (count < BATCH)
+                        {
+                            batch[count] = T();
+
+                            if (!m_function(batch[count])) break;
+
+                            count++;
+                        }
+
+                        m_metrics.busyTime += getTick() - start;
+                        m_metrics.items += count;
+
+                        // Sleep, so an exhausted source does not keep the Context busy
+                        if (count == 0) yield(getMetrics().nice ? getMetrics().nice : m_pipeline.m_pollPeriod);
+
+                        return count;
+                    }
+
+                    size_t consume(T* batch)
+                    {
+                        Tag tag{0, 0};
+
+                        while (m_input.isEmpty())
+                        {
+                            Time start = getTick();
+
+                            if (!wait(m_input.getRefId(), tag, TIME::UNDERFINED, Queue<T, DEPTH>::DATA_CHANNEL) && m_metrics.stackOverflow)
+                                return 0;
+
+                            m_metrics.starvedTime += getTick() - start;
+                        }
+
+                        m_metrics.occupancySum += m_input.size();
+
+                        size_t count = 0;
+                        Time start = getTick();
+                        T item;
+
+                        while (count < BATCH && m_input.pop(item))
+                        {
+                            m_metrics.items++;
+
+                            if (m_function(item))
+                                batch[count++] = item;
+                            else
+                                m_metrics.dropped++;
+                        }
+
+                        m_metrics.busyTime += getTick() - start;
+
+                        // One wakeup for all the slots released by this batch
+                        notify(m_input.getRefId(), Notify::ONE, {0, 0}, TIME::UNDERFINED, Queue<T, DEPTH>::SPACE_CHANNEL);
+
+                        return count;
+                    }
+
+                    void forward(T* batch, size_t count)
+                    {
+                        m_metrics.batches++;
+
+                        if (m_next == nullptr || count == 0) return;
+
+                        Queue<T, DEPTH>& output = m_next->m_input;
+                        Tag tag{0, 0};
+
+                        for (size_t nCount = 0; nCount < count; nCount++)
+                        {
+                            while (!output.push(batch[nCount]))
+                            {
+                                // Hand over what is queued and park until it is drained
+                                notify(output.getRefId(), Notify::ONE, {0, 0}, TIME::UNDERFINED, Queue<T, DEPTH>::DATA_CHANNEL);
+
+                                if (!output.isFull()) continue;
+
+                                Time start = getTick();
+
+                                if (!wait(output.getRefId(), tag, TIME::UNDERFINED, Queue<T, DEPTH>::SPACE_CHANNEL) && m_metrics.stackOverflow)
+                                    return;
+
+                                m_metrics.blockedTime += getTick() - start;
+                            }
+                        }
+
+                        notify(output.getRefId(), Notify::ONE, {0, count}, TIME::UNDERFINED, Queue<T, DEPTH>::DATA_CHANNEL);
+                    }
+
+                    Pipeline& m_pipeline;
+                    const char* m_name;
+                    Function m_function;
+
+                    Queue<T, DEPTH> m_input;
+                    StageMetrics m_metrics;
+
+                    Node* m_prev{nullptr};
+                    Node* m_next{nullptr};
+            };
+
+            /**
+             * @brief Pipeline stage with its own virtual stack memory
+             *
+             * @tparam STACK  Stack size in size_t words, see VMEM
+             */
+            template <size_t STACK>
+            class Stage : public Node
+            {
+                public:
+                    Stage(Pipeline& pipeline, const char* name, Function function) :
+                        Node(pipeline, name, function, VMEM(vmemory))
+                    {}
+
+                private:
+                    size_t vmemory[STACK];
+            };
+
+            /**
+             * @param pollPeriod  Ticks between calls to an exhausted source
+             *                    function, used when the source nice is 0
+             */
+            Pipeline(Time pollPeriod = ATOMICX_PIPELINE_POLL) : m_pollPeriod(pollPeriod ? pollPeriod : 1)
+            {}
+
+            Node* begin()
+            {
+                return m_first;
+            }
+
+            size_t getStageCount() const
+            {
+                return m_count;
+            }
+
+            /**
+             * @brief Return the stage spending the most time on its function
+             *
+             * Parked time alone does not tell, a stage also loses the CPU
+             * on the yield of every notify, while all the stages run for the
+             * same period so the one with the highest busy time (and busy
+             * share) is the one holding the pipeline throughput.
+             */
+            Node* getBottleneck()
+            {
+                Node* bottleneck = m_first;
+
+                for (Node* node = m_first; node != nullptr; node = node->m_next)
+                {
+                    if (node->m_metrics.busyTime > bottleneck->m_metrics.busyTime)
+                        bottleneck = node;
+                }
+
+                return bottleneck;
+            }
+
+        private:
+            void append(Node* node)
+            {
+                if (m_first == nullptr)
+                {
+                    m_first = node;
+                }
+                else
+                {
+                    m_last->m_next = node;
+                    node->m_prev = m_last;
+                }
+
+                m_last = node;
+                m_count++;
+            }
+
+            Node* m_first{nullptr};
+            Node* m_last{nullptr};
+            size_t m_count{0};
+
+            Time m_pollPeriod;
+    };
+
+}; // namespace ax
+
+#endif // ATOMICX_PIPELINE_H
@@ -0,0 +1,112 @@
+/**
+ * @file queue.h
+ * @brief AtomicX bounded queue
+ *
+ * Fixed capacity ring buffer used to move items between threads. It does
+ * not allocate and does not depend on the STL so it can be used on small
+ * microprocessors, the RefId embedded on it is used by the threads to
+ * wait for data or for free space using the regular wait / notify calls.
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ATOMICX_QUEUE_H
+#define ATOMICX_QUEUE_H
+
+#include "atomicx.h"
+
+namespace ax {
+
+    /**
+     * @brief Bounded FIFO queue
+     *
+     * @tparam T     Item type, must be copy assignable
+     * @tparam SIZE  Maximum number of items
+     */
+    template <typename T, size_t SIZE>
+    class Queue
+    {
+        public:
+
+            // Wait / notify channels used over getRefId()
+            enum : uint8_t
+            {
+                DATA_CHANNEL = 1,
+                SPACE_CHANNEL = 2
+            };
+
+            bool push(const T& item)
+            {
+                if (m_count == SIZE) return false;
+
+                m_items[m_tail] = item;
+                m_tail = (m_tail + 1) % SIZE;
+                m_count++;
+
+                if (m_count > m_highWater) m_highWater = m_count;
+
+                return true;
+            }
+
+            bool pop(T& item)
+            {
+                if (m_count == 0) return false;
+
+                item = m_items[m_head];
+                m_head = (m_head + 1) % SIZE;
+                m_count--;
+
+                return true;
+            }
+
+            size_t size() const
+            {
+                return m_count;
+            }
+
+            size_t capacity() const
+            {
+                return SIZE;
+            }
+
+            size_t getHighWater() const
+            {
+                return m_highWater;
+            }
+
+            bool isEmpty() const
+            {
+                return m_count == 0;
+            }
+
+            bool isFull() const
+            {
+                return m_count == SIZE;
+            }
+
+            RefId& getRefId()
+            {
+                return m_refId;
+            }
+
+        private:
+            T m_items[SIZE];
+
+            size_t m_head{0};
+            size_t m_tail{0};
+            size_t m_count{0};
+            size_t m_highWater{0};
+
+            RefId m_refId{0};
+    };
+
+}; // namespace ax
+
+#endif // ATOMICX_QUEUE_H
@@ -0,0 +1,537 @@
+/**
+ * @file shmchannel.cpp
+ * @brief AtomicX cross process shared memory channel
+ *
+ * The ring is a bounded multiple producer queue where every cell carries
+ * a sequence number telling whether it is free for the producer at that
+ * position or holds data for the consumer, so producers only contend on
+ * a compare and swap of the enqueue position.
+ *
+ * Wakeup protocol, for both directions: the idle side reads the bell,
+ * flags itself idle, checks the ring again and only then futex waits on
+ * the bell value read. The active side bumps the bell after changing the
+ * ring and only calls futex wake when the idle flag is set. An idle
+ * process waits on the bells of all its rings with waiters at once.
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ARDUINO
+
+#include "shmchannel.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define ATOMICX_SHM_MAGIC 0x41584348 // "AXCH"
+
+// Attempts (1ms apart) to wait for the creator to initialize the mapping
+#define ATOMICX_SHM_ATTACH_RETRIES 1000
+
+// Rings waited by a single futex_waitv, at most FUTEX_WAITV_MAX
+#define ATOMICX_SHM_WAITV_MAX 32
+
+#if defined(__linux__) && defined(__NR_futex_waitv) && defined(FUTEX_32)
+#define ATOMICX_SHM_WAITV
+#endif
+
+namespace ax {
+
+    struct ShmHeader
+    {
+        uint32_t magic;
+        uint32_t capacity;
+        uint32_t itemSize;
+        uint32_t cellSize;
+
+        alignas(64) uint64_t enqueuePos;
+        alignas(64) uint64_t dequeuePos;
+
+        alignas(64) uint32_t dataBell;
+        uint32_t receiverIdle;
+
+        alignas(64) uint32_t spaceBell;
+        uint32_t sendersIdle;
+    };
+
+    struct ShmCell
+    {
+        uint64_t sequence;
+        uint8_t data[1];
+    };
+
+    static size_t cellSize(size_t itemSize)
+    {
+        size_t size = offsetof(ShmCell, data) + itemSize;
+
+        return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    }
+
+    static void futexWait(uint32_t* bell, uint32_t value, Time ticks, bool forever)
+    {
+#ifdef __linux__
+        struct timespec timeout;
+        uint64_t ns = (uint64_t) ticks * ATOMICX_TICK_NS;
+
+        timeout.tv_sec = (time_t) (ns / 1000000000);
+        timeout.tv_nsec = (long) (ns % 1000000000);
+
+        syscall(SYS_futex, bell, FUTEX_WAIT, value, forever ? nullptr : &timeout, nullptr, 0);
+#else
+        (void) bell; (void) value; (void) forever;
+
+        // No futex, poll the ring once per tick
+        usleep((useconds_t) ((ticks ? ticks : 1) * ATOMICX_TICK_NS / 1000));
+#endif
+    }
+
+    // Wait until any bell moves, false if futex_waitv is not available
+    static bool futexWaitAll(uint32_t** bells, uint32_t* values, size_t count, Time ticks, bool forever)
+    {
+#ifdef ATOMICX_SHM_WAITV
+        struct futex_waitv waiters[ATOMICX_SHM_WAITV_MAX];
+        struct timespec timeout;
+
+        for (size_t nCount = 0; nCount < count; nCount++)
+        {
+            waiters[nCount].val = values[nCount];
+            waiters[nCount].uaddr = (uint64_t) (uintptr_t) bells[nCount];
+            waiters[nCount].flags = FUTEX_32;
+            waiters[nCount].__reserved = 0;
+        }
+
+        // The futex_waitv timeout is an absolute deadline
+        clock_gettime(CLOCK_MONOTONIC, &timeout);
+
+        uint64_t ns = (uint64_t) timeout.tv_nsec + (uint64_t) ticks * ATOMICX_TICK_NS;
+
+        timeout.tv_sec += (time_t) (ns / 1000000000);
+        timeout.tv_nsec = (long) (ns % 1000000000);
+
+        return syscall(__NR_futex_waitv, waiters, (unsigned int) count, 0, forever ? nullptr : &timeout, CLOCK_MONOTONIC) >= 0
+            || errno != ENOSYS;
+#else
+        (void) bells; (void) values; (void) count; (void) ticks; (void) forever;
+
+        return false;
+#endif
+    }
+
+    static void futexWake(uint32_t* bell)
+    {
+#ifdef __linux__
+        syscall(SYS_futex, bell, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+        (void) bell;
+#endif
+    }
+
+    // ----------------------------------------------
+    // ShmWakeGroup methods implementation
+    // ----------------------------------------------
+
+    /**
+     * @brief The WakeSource of all the rings of the process, so an
+     *        idle Context blocks on all their bells at once
+     */
+    class ShmWakeGroup : public WakeSource
+    {
+    public:
+        void add(ShmRing* ring)
+        {
+            ring->m_next = m_first;
+            m_first = ring;
+        }
+
+        void remove(ShmRing* ring)
+        {
+            for (ShmRing** node = &m_first; *node != nullptr; node = &(*node)->m_next)
+            {
+                if (*node == ring)
+                {
+                    *node = ring->m_next;
+                    break;
+                }
+            }
+        }
+
+        bool poll() override
+        {
+            bool woken = false;
+
+            for (ShmRing* ring = m_first; ring != nullptr; ring = ring->m_next)
+            {
+                if (ring->poll()) woken = true;
+            }
+
+            return woken;
+        }
+
+        bool hasWaiters() override
+        {
+            for (ShmRing* ring = m_first; ring != nullptr; ring = ring->m_next)
+            {
+                if (ring->hasWaiters()) return true;
+            }
+
+            return false;
+        }
+
+        void idle(Time ticks, bool forever) override;
+
+    private:
+        ShmRing* m_first{nullptr};
+        size_t m_turn{0};
+    };
+
+    static ShmWakeGroup& wakeGroup()
+    {
+        // Built on first use, so after the Context it registers with
+        static ShmWakeGroup group;
+
+        return group;
+    }
+
+    void ShmWakeGroup::idle(Time ticks, bool forever)
+    {
+        uint32_t* bells[ATOMICX_SHM_WAITV_MAX];
+        uint32_t values[ATOMICX_SHM_WAITV_MAX];
+        size_t count = 0;
+        bool ready = false;
+        bool partial = false;
+
+        for (ShmRing* ring = m_first; ring != nullptr; ring = ring->m_next)
+        {
+            if (!ring->hasWaiters()) continue;
+
+            if (count == ATOMICX_SHM_WAITV_MAX)
+            {
+                partial = true;
+                break;
+            }
+
+            if (!ring->enterIdle(bells[count], values[count]))
+            {
+                ready = true;
+                break;
+            }
+
+            count++;
+        }
+
+        // Rings left out are only checked again after a slice
+        if (partial && (forever || ticks > ATOMICX_WAKE_SLICE_MAX))
+        {
+            ticks = ATOMICX_WAKE_SLICE_MAX;
+            forever = false;
+        }
+
+        if (ready)
+        {
+            // An event arrived meanwhile, no wait
+        }
+        else if (count == 0)
+        {
+            if (!forever) sleepTicks(ticks);
+        }
+        else if (count == 1)
+        {
+            futexWait(bells[0], values[0], ticks, forever);
+        }
+        else if (!futexWaitAll(bells, values, count, ticks, forever))
+        {
+            // No futex_waitv, the rings are waited in turns
+            size_t turn = m_turn++ % count;
+
+            futexWait(bells[turn], values[turn], (forever || ticks > ATOMICX_WAKE_SLICE_MAX) ? ATOMICX_WAKE_SLICE_MAX : ticks, false);
+        }
+
+        for (ShmRing* ring = m_first; ring != nullptr; ring = ring->m_next)
+            ring->leaveIdle();
+    }
+
+    // ----------------------------------------------
+    // ShmRing methods implementation
+    // ----------------------------------------------
+
+    ShmRing::ShmRing(const char* name, ShmSide side, size_t capacity, size_t itemSize) : m_side(side)
+    {
+        wakeGroup().add(this);
+
+        size_t cell = cellSize(itemSize);
+        size_t mapSize = sizeof(ShmHeader) + cell * capacity;
+        bool creator = true;
+
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+        if (fd < 0)
+        {
+            creator = false;
+            fd = shm_open(name, O_RDWR, 0600);
+        }
+
+        if (fd < 0) return;
+
+        if (creator && ftruncate(fd, (off_t) mapSize) != 0)
+        {
+            close(fd);
+            return;
+        }
+
+        // Peer attaching while the creator is still sizing the mapping
+        struct stat info;
+
+        for (size_t nCount = 0; !creator && nCount < ATOMICX_SHM_ATTACH_RETRIES; nCount++)
+        {
+            if (fstat(fd, &info) == 0 && (size_t) info.st_size >= mapSize) break;
+
+            usleep(1000);
+        }
+
+        void* map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close(fd);
+
+        if (map == MAP_FAILED) return;
+
+        ShmHeader* header = (ShmHeader*) map;
+        uint8_t* cells = (uint8_t*) map + sizeof(ShmHeader);
+
+        if (creator)
+        {
+            header->capacity = (uint32_t) capacity;
+            header->itemSize = (uint32_t) itemSize;
+            header->cellSize = (uint32_t) cell;
+
+            for (size_t nCount = 0; nCount < capacity; nCount++)
+                ((ShmCell*) (cells + nCount * cell))->sequence = nCount;
+
+            __atomic_store_n(&header->magic, ATOMICX_SHM_MAGIC, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            for (size_t nCount = 0; nCount < ATOMICX_SHM_ATTACH_RETRIES; nCount++)
+            {
+                if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == ATOMICX_SHM_MAGIC) break;
+
+                usleep(1000);
+            }
+
+            if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != ATOMICX_SHM_MAGIC
+                || header->capacity != capacity || header->itemSize != itemSize)
+            {
+                munmap(map, mapSize);
+                return;
+            }
+        }
+
+        m_header = header;
+        m_cells = cells;
+        m_mapSize = mapSize;
+    }
+
+    ShmRing::~ShmRing()
+    {
+        wakeGroup().remove(this);
+
+        if (m_header != nullptr) munmap(m_header, m_mapSize);
+    }
+
+    bool ShmRing::isOpen()
+    {
+        return m_header != nullptr;
+    }
+
+    bool ShmRing::unlink(const char* name)
+    {
+        return shm_unlink(name) == 0;
+    }
+
+    bool ShmRing::isReadable()
+    {
+        uint64_t pos = __atomic_load_n(&m_header->dequeuePos, __ATOMIC_RELAXED);
+        ShmCell* cell = (ShmCell*) (m_cells + (pos & (m_header->capacity - 1)) * m_header->cellSize);
+
+        return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) == pos + 1;
+    }
+
+    bool ShmRing::isWritable()
+    {
+        uint64_t pos = __atomic_load_n(&m_header->enqueuePos, __ATOMIC_RELAXED);
+        ShmCell* cell = (ShmCell*) (m_cells + (pos & (m_header->capacity - 1)) * m_header->cellSize);
+
+        return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) == pos;
+    }
+
+    bool ShmRing::push(const void* item)
+    {
+        if (m_header == nullptr) return false;
+
+        uint64_t pos = __atomic_load_n(&m_header->enqueuePos, __ATOMIC_RELAXED);
+        ShmCell* cell = nullptr;
+
+        while (true)
+        {
+            cell = (ShmCell*) (m_cells + (pos & (m_header->capacity - 1)) * m_header->cellSize);
+
+            int64_t diff = (int64_t) __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (int64_t) pos;
+
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&m_header->enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = __atomic_load_n(&m_header->enqueuePos, __ATOMIC_RELAXED);
+        }
+
+        memcpy(cell->data, item, m_header->itemSize);
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+        __atomic_add_fetch(&m_header->dataBell, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&m_header->receiverIdle, __ATOMIC_SEQ_CST))
+            futexWake(&m_header->dataBell);
+
+        return true;
+    }
+
+    bool ShmRing::pop(void* item)
+    {
+        if (m_header == nullptr) return false;
+
+        uint64_t pos = __atomic_load_n(&m_header->dequeuePos, __ATOMIC_RELAXED);
+        ShmCell* cell = (ShmCell*) (m_cells + (pos & (m_header->capacity - 1)) * m_header->cellSize);
+
+        // Single consumer, no contention on the dequeue position
+        if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + 1) return false;
+
+        memcpy(item, cell->data, m_header->itemSize);
+
+        __atomic_store_n(&m_header->dequeuePos, pos + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&cell->sequence, pos + m_header->capacity, __ATOMIC_RELEASE);
+
+        __atomic_add_fetch(&m_header->spaceBell, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&m_header->sendersIdle, __ATOMIC_SEQ_CST))
+            futexWake(&m_header->spaceBell);
+
+        return true;
+    }
+
+    bool ShmRing::send(const void* item, Timeout timeout)
+    {
+        Tag tag{0, 0};
+
+        while (!push(item))
+        {
+            if (m_header == nullptr) return false;
+
+            m_waiting++;
+            bool ret = ctx().wait(m_refId, tag, timeout, SPACE_CHANNEL);
+            m_waiting--;
+
+            if (!ret) return false;
+        }
+
+        return true;
+    }
+
+    bool ShmRing::receive(void* item, Timeout timeout)
+    {
+        Tag tag{0, 0};
+
+        while (!pop(item))
+        {
+            if (m_header == nullptr) return false;
+
+            m_waiting++;
+            bool ret = ctx().wait(m_refId, tag, timeout, DATA_CHANNEL);
+            m_waiting--;
+
+            if (!ret) return false;
+        }
+
+        return true;
+    }
+
+    bool ShmRing::poll()
+    {
+        if (!hasWaiters()) return false;
+
+        if (m_side == ShmSide::RECEIVER)
+            return isReadable() && ctx().signal(m_refId, Notify::ONE, {0, 0}, DATA_CHANNEL) > 0;
+
+        return isWritable() && ctx().signal(m_refId, Notify::ONE, {0, 0}, SPACE_CHANNEL) > 0;
+    }
+
+    bool ShmRing::hasWaiters()
+    {
+        return m_waiting > 0 && m_header != nullptr;
+    }
+
+    bool ShmRing::enterIdle(uint32_t*& bell, uint32_t& value)
+    {
+        m_idle = true;
+
+        if (m_side == ShmSide::RECEIVER)
+        {
+            bell = &m_header->dataBell;
+            value = __atomic_load_n(bell, __ATOMIC_SEQ_CST);
+
+            __atomic_store_n(&m_header->receiverIdle, 1, __ATOMIC_SEQ_CST);
+
+            if (!isReadable()) return true;
+        }
+        else
+        {
+            bell = &m_header->spaceBell;
+            value = __atomic_load_n(bell, __ATOMIC_SEQ_CST);
+
+            __atomic_add_fetch(&m_header->sendersIdle, 1, __ATOMIC_SEQ_CST);
+
+            if (!isWritable()) return true;
+        }
+
+        leaveIdle();
+
+        return false;
+    }
+
+    void ShmRing::leaveIdle()
+    {
+        if (!m_idle) return;
+
+        m_idle = false;
+
+        if (m_side == ShmSide::RECEIVER)
+            __atomic_store_n(&m_header->receiverIdle, 0, __ATOMIC_SEQ_CST);
+        else
+            __atomic_sub_fetch(&m_header->sendersIdle, 1, __ATOMIC_SEQ_CST);
+    }
+
+}; // namespace ax
+
+#endif // ARDUINO
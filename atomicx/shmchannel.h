@@ -0,0 +1,167 @@
+/**
+ * @file shmchannel.h
+ * @brief AtomicX cross process shared memory channel
+ *
+ * Lock free ring buffer placed on a POSIX shared memory mapping, used to
+ * pass messages between atomicx processes on the same host. Any number of
+ * processes can send (MPSC) to the single receiving process.
+ *
+ * Inside each process the sending and receiving threads park in WAIT on
+ * the channel RefId, all the channels of the process share one WakeSource
+ * so they are polled on every scheduling pass, and only an idle Context
+ * blocks on the ring futexes, all of them at once with futex_waitv. A
+ * busy peer never issues a system call, the futex is only woken when the
+ * other side declared itself idle.
+ *
+ * @note Linux only for the futex wakeup, other POSIX systems fall back to
+ * a one tick polling sleep while idle. Without futex_waitv (Linux < 5.16)
+ * several channels with waiters are waited one at a time, in turns of up
+ * to ATOMICX_WAKE_SLICE_MAX ticks, which bounds the wakeup latency of
+ * the others. Not available on Arduino.
+ *
+ * @code
+ *  // Acquisition process
+ *  ax::ShmChannel<Sample, 1024> channel("/acquisition", ax::ShmSide::SENDER);
+ *  channel.send(sample);
+ *
+ *  // Publisher process
+ *  ax::ShmChannel<Sample, 1024> channel("/acquisition", ax::ShmSide::RECEIVER);
+ *  channel.receive(sample);
+ * @endcode
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ATOMICX_SHMCHANNEL_H
+#define ATOMICX_SHMCHANNEL_H
+
+#ifndef ARDUINO
+
+#include "atomicx.h"
+
+namespace ax {
+
+    enum class ShmSide
+    {
+        SENDER,
+        RECEIVER
+    };
+
+    struct ShmHeader;
+
+    class ShmWakeGroup;
+
+    /**
+     * @brief Type less shared memory ring, see ShmChannel
+     */
+    class ShmRing
+    {
+    public:
+        ShmRing(const char* name, ShmSide side, size_t capacity, size_t itemSize);
+
+        virtual ~ShmRing();
+
+        // Mapping is created or attached and matches capacity and item size
+        bool isOpen();
+
+        // Remove the shared memory name, mapped peers are not affected
+        static bool unlink(const char* name);
+
+        // Notify the local threads waiting on the ring, true if any was woken
+        bool poll();
+
+        bool hasWaiters();
+
+    protected:
+        bool send(const void* item, Timeout timeout);
+
+        bool receive(void* item, Timeout timeout);
+
+        bool push(const void* item);
+
+        bool pop(void* item);
+
+    private:
+        friend class ShmWakeGroup;
+
+        enum : uint8_t
+        {
+            DATA_CHANNEL = 1,
+            SPACE_CHANNEL = 2
+        };
+
+        bool isReadable();
+
+        bool isWritable();
+
+        // Flag this side idle and give the futex to wait on,
+        // false (and not flagged) if the ring is already ready
+        bool enterIdle(uint32_t*& bell, uint32_t& value);
+
+        void leaveIdle();
+
+        ShmHeader* m_header{nullptr};
+        uint8_t* m_cells{nullptr};
+        size_t m_mapSize{0};
+
+        ShmSide m_side;
+
+        // Local threads parked on the ring
+        size_t m_waiting{0};
+
+        RefId m_refId{0};
+
+        bool m_idle{false};
+        ShmRing* m_next{nullptr};
+    };
+
+    /**
+     * @brief Shared memory channel of T items
+     *
+     * @tparam T     Item type, must be trivially copyable
+     * @tparam SIZE  Ring capacity, must be a power of 2
+     */
+    template <typename T, size_t SIZE>
+    class ShmChannel : public ShmRing
+    {
+        static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "ShmChannel SIZE must be a power of 2");
+
+    public:
+        ShmChannel(const char* name, ShmSide side) : ShmRing(name, side, SIZE, sizeof(T))
+        {}
+
+        // Park until there is room on the ring, false on timeout
+        bool send(const T& item, Timeout timeout = TIME::UNDERFINED)
+        {
+            return ShmRing::send(&item, timeout);
+        }
+
+        // Park until an item arrives, false on timeout
+        bool receive(T& item, Timeout timeout = TIME::UNDERFINED)
+        {
+            return ShmRing::receive(&item, timeout);
+        }
+
+        bool trySend(const T& item)
+        {
+            return push(&item);
+        }
+
+        bool tryReceive(T& item)
+        {
+            return pop(&item);
+        }
+    };
+
+}; // namespace ax
+
+#endif // ARDUINO
+
+#endif // ATOMICX_SHMCHANNEL_H
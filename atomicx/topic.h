@@ -0,0 +1,251 @@
+/**
+ * @file topic.h
+ * @brief AtomicX publish / subscribe topic
+ *
+ * A topic is a single writer ring buffer where every subscriber keeps its
+ * own read cursor, so a busy subscriber does not lose events published
+ * while it was not waiting and a slow subscriber never blocks the
+ * publisher or the other subscribers, it only loses the oldest items once
+ * the ring wraps over its cursor (the lost matching items are reported
+ * by getMissed()).
+ *
+ * Every publication carries a channel and a key, subscribers filter on
+ * them and only the parked subscribers matching the publication are woken.
+ *
+ * @note Subscribers are accessed by the publisher while the subscriber
+ * thread is switched out, so they must be members of the thread object
+ * or static, never locals inside run().
+ *
+ * @code
+ *  ax::Topic<Reading, 32> sensors;
+ *
+ *  // On the subscriber thread class
+ *  ax::Topic<Reading, 32>::Subscriber temperature{sensors, TEMPERATURE};
+ *
+ *  // Publisher thread
+ *  sensors.publish(reading, TEMPERATURE, sensorId);
+ *
+ *  // Subscriber thread
+ *  while (temperature.receive(reading)) { ... }
+ * @endcode
+ *
+ * @version 2.0.0.proto
+ * @date __TIMESTAMP__
+ *
+ * @section License
+ * Licensed under the MIT License.
+ *
+ * @section Author
+ * Gustavo Campos lgustavocampos@gmail.com
+ */
+
+#ifndef ATOMICX_TOPIC_H
+#define ATOMICX_TOPIC_H
+
+#include "atomicx.h"
+
+namespace ax {
+
+    /**
+     * @brief Single writer, multiple reader topic
+     *
+     * @tparam T     Item type, must be copy assignable
+     * @tparam SIZE  Ring capacity, must be a power of 2 so the
+     *               sequence numbers wrap around consistently
+     */
+    template <typename T, size_t SIZE>
+    class Topic
+    {
+        static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "Topic SIZE must be a power of 2");
+
+        public:
+
+            // Subscriber filter wildcards, so channel 0 and key 0 cannot be
+            // filtered on, items published with them only reach the
+            // subscribers using the wildcard
+            enum : uint8_t { ANY_CHANNEL = 0 };
+            enum : size_t { ANY_KEY = 0 };
+
+            class Subscriber
+            {
+                public:
+                    Subscriber(Topic& topic, uint8_t channel = ANY_CHANNEL, size_t key = ANY_KEY) :
+                        m_topic(topic), m_channel(channel), m_key(key), m_cursor(topic.m_writeSeq)
+                    {
+                        m_topic.subscribe(this);
+                    }
+
+                    ~Subscriber()
+                    {
+                        m_topic.unsubscribe(this);
+                    }
+
+                    /**
+                     * @brief Read the next matching item, parking until one
+                     *        is published or the timeout expires
+                     *
+                     * @return false on timeout
+                     */
+                    bool receive(T& item, Timeout timeout = TIME::UNDERFINED)
+                    {
+                        Tag tag{0, 0};
+
+                        while (!tryReceive(item))
+                        {
+                            m_waiting = true;
+                            bool ret = ctx().wait(m_refId, tag, timeout, DATA_CHANNEL);
+                            m_waiting = false;
+
+                            if (!ret) return false;
+                        }
+
+                        return true;
+                    }
+
+                    // Read the next matching item without parking
+                    bool tryReceive(T& item)
+                    {
+                        // The publisher keeps the cursor within the ring
+                        const size_t writeSeq = m_topic.m_writeSeq;
+
+                        while (m_cursor != writeSeq)
+                        {
+                            const Entry& entry = m_topic.m_items[m_cursor & (SIZE - 1)];
+
+                            m_cursor++;
+
+                            if (matches(entry.channel, entry.key))
+                            {
+                                item = entry.item;
+                                m_received++;
+                                return true;
+                            }
+                        }
+
+                        return false;
+                    }
+
+                    // Items on the ring not yet seen by this subscriber (matching or not)
+                    size_t getPending() const
+                    {
+                        return m_topic.m_writeSeq - m_cursor;
+                    }
+
+                    // Matching items overwritten before this subscriber read them
+                    size_t getMissed() const
+                    {
+                        return m_missed;
+                    }
+
+                    size_t getReceived() const
+                    {
+                        return m_received;
+                    }
+
+                private:
+                    friend class Topic;
+
+                    enum : uint8_t { DATA_CHANNEL = 1 };
+
+                    bool matches(uint8_t channel, size_t key) const
+                    {
+                        return (m_channel == ANY_CHANNEL || m_channel == channel)
+                            && (m_key == ANY_KEY || m_key == key);
+                    }
+
+                    Topic& m_topic;
+                    uint8_t m_channel;
+                    size_t m_key;
+
+                    size_t m_cursor;
+                    size_t m_missed{0};
+                    size_t m_received{0};
+
+                    bool m_waiting{false};
+                    RefId m_refId{0};
+
+                    Subscriber* m_next{nullptr};
+            };
+
+            /**
+             * @brief Publish an item, must be called from a thread
+             *
+             * Never blocks, wakes the parked subscribers matching channel
+             * and key and yields once if any was woken.
+             *
+             * @return Number of subscribers woken
+             */
+            size_t publish(const T& item, uint8_t channel = ANY_CHANNEL, size_t key = ANY_KEY)
+            {
+                Entry& entry = m_items[m_writeSeq & (SIZE - 1)];
+
+                // Move the cursors still on the overwritten entry past it
+                for (Subscriber* subscriber = m_first; subscriber != nullptr; subscriber = subscriber->m_next)
+                {
+                    if (m_writeSeq - subscriber->m_cursor == SIZE)
+                    {
+                        if (subscriber->matches(entry.channel, entry.key)) subscriber->m_missed++;
+
+                        subscriber->m_cursor++;
+                    }
+                }
+
+                entry.item = item;
+                entry.channel = channel;
+                entry.key = key;
+
+                m_writeSeq++;
+
+                size_t count = 0;
+
+                for (Subscriber* subscriber = m_first; subscriber != nullptr; subscriber = subscriber->m_next)
+                {
+                    if (subscriber->m_waiting && subscriber->matches(channel, key))
+                        count += ctx().signal(subscriber->m_refId, Notify::ONE, {channel, key}, Subscriber::DATA_CHANNEL);
+                }
+
+                if (count) ctx().yield(0, STATE::NOW);
+
+                return count;
+            }
+
+            size_t getPublished() const
+            {
+                return m_writeSeq;
+            }
+
+        private:
+            struct Entry
+            {
+                T item;
+                uint8_t channel;
+                size_t key;
+            };
+
+            void subscribe(Subscriber* subscriber)
+            {
+                subscriber->m_next = m_first;
+                m_first = subscriber;
+            }
+
+            void unsubscribe(Subscriber* subscriber)
+            {
+                for (Subscriber** node = &m_first; *node != nullptr; node = &(*node)->m_next)
+                {
+                    if (*node == subscriber)
+                    {
+                        *node = subscriber->m_next;
+                        break;
+                    }
+                }
+            }
+
+            Entry m_items[SIZE];
+            size_t m_writeSeq{0};
+
+            Subscriber* m_first{nullptr};
+    };
+
+}; // namespace ax
+
+#endif // ATOMICX_TOPIC_H